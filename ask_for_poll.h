@@ -0,0 +1,150 @@
+/*
+    Busy-poll input for ask_for, for POSIX systems
+    Copyright (C) 2017 Fergus Waugh
+
+    Permission is hereby granted, free of charge, to any person obtaining
+    a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+    TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+    OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef ASK_FOR_POLL_H_7QX2MD4K
+#define ASK_FOR_POLL_H_7QX2MD4K
+
+#include "ask_for.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Hint to the processor that the thread is spinning
+inline void spin_pause()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+struct Poll_policy {
+    std::size_t spin_reads = 100000; // Failed reads to spin through before parking
+    int park_timeout_ms = -1;        // Longest time to park in poll() at once, -1 for no limit
+    int cpu = -1;                    // CPU to pin the reading thread to, -1 for none (Linux only)
+};
+
+// Stream buffer that reads from a file descriptor in non-blocking mode, spinning on read() so that
+// data is picked up as soon as it arrives rather than after a wake-up. After policy.spin_reads
+// empty reads it parks in poll() until data arrives. A policy.park_timeout_ms only bounds each
+// park; a thread that times out checks once and parks again, and spins again once data is read.
+//
+// The reading thread is pinned to policy.cpu on construction, so construct it on that thread. A
+// read error is thrown from underflow, so that the stream sets badbit rather than seeing an end of
+// file.
+class Poll_streambuf : public std::streambuf {
+public:
+    explicit Poll_streambuf(int fd, Poll_policy policy = {}, std::size_t buffer_size = 1 << 16)
+        : fd_{fd}, policy_{policy}, buffer_(buffer_size > 0 ? buffer_size : 1)
+    {
+        flags_ = ::fcntl(fd_, F_GETFL);
+        if (flags_ == -1 || ::fcntl(fd_, F_SETFL, flags_ | O_NONBLOCK) == -1) {
+            throw std::runtime_error("Cannot make file descriptor non-blocking");
+        }
+
+        if (policy_.cpu >= 0) pin_to_cpu(policy_.cpu);
+    }
+
+    Poll_streambuf(const Poll_streambuf&) = delete;
+    Poll_streambuf& operator=(const Poll_streambuf&) = delete;
+
+    // The descriptor may be shared, so put its flags back
+    ~Poll_streambuf() override { ::fcntl(fd_, F_SETFL, flags_); }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+        std::size_t spins = 0;
+        while (true) {
+            const auto n = ::read(fd_, buffer_.data(), buffer_.size());
+            if (n > 0) {
+                setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+                return traits_type::to_int_type(*gptr());
+            }
+            if (n == 0) return traits_type::eof();
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fail("Cannot read from file descriptor");
+
+            if (spins < policy_.spin_reads) {
+                ++spins;
+                spin_pause();
+                continue;
+            }
+
+            pollfd p{fd_, POLLIN, 0};
+            if (::poll(&p, 1, policy_.park_timeout_ms) == -1 && errno != EINTR) {
+                fail("Cannot poll file descriptor");
+            }
+        }
+    }
+
+private:
+    [[noreturn]] static void fail(const std::string& message)
+    {
+        throw std::runtime_error(message + ": " + std::strerror(errno));
+    }
+
+    static void pin_to_cpu(int cpu)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0) {
+            throw std::runtime_error("Cannot pin thread to CPU " + std::to_string(cpu));
+        }
+#else
+        (void)cpu;
+#endif
+    }
+
+    int fd_;
+    int flags_;
+    Poll_policy policy_;
+    std::vector<char> buffer_;
+};
+
+// Input stream over a Poll_streambuf, for use with ask_stream and ask_for_all
+class Poll_stream : public std::istream {
+public:
+    explicit Poll_stream(int fd, Poll_policy policy = {})
+        : std::istream{nullptr}, buffer_{fd, policy}
+    {
+        rdbuf(&buffer_);
+    }
+
+private:
+    Poll_streambuf buffer_;
+};
+
+#endif /* end of include guard: ASK_FOR_POLL_H_7QX2MD4K */
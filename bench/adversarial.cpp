@@ -0,0 +1,129 @@
+// Worst-case and tail latency of line parsing on adversarial input. For every supported type, each
+// generator produces lines designed to stress the parser (huge digit strings, thousands of tokens,
+// extreme exponents, long runs of whitespace), and the time to fill the type from each line is
+// measured individually. Results are per-line percentiles and the maximum, in microseconds.
+//
+//     g++ -std=c++14 -O2 -I.. adversarial.cpp -o adversarial && ./adversarial [lines per case]
+
+#include "../ask_for.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+namespace {
+
+using Generator = std::function<std::string(std::mt19937_64&)>;
+
+std::string digits(std::mt19937_64& engine, std::size_t n)
+{
+    std::string s(n, '0');
+    for (auto& c : s) c = static_cast<char>('0' + engine() % 10);
+    if (n > 0 && s[0] == '0') s[0] = '1';
+    return s;
+}
+
+std::string tokens(std::mt19937_64& engine, std::size_t n, const char* separator = " ")
+{
+    std::string s;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i) s += separator;
+        s += std::to_string(engine() % 100000);
+    }
+    return s;
+}
+
+const std::vector<std::pair<const char*, Generator>>& generators()
+{
+    static const std::vector<std::pair<const char*, Generator>> list = {
+        {"typical", [](std::mt19937_64& e) { return std::to_string(e() % 100000); }},
+        {"huge digits", [](std::mt19937_64& e) { return digits(e, 100000); }},
+        {"huge decimal",
+         [](std::mt19937_64& e) { return digits(e, 50000) + "." + digits(e, 50000); }},
+        {"extreme exponent",
+         [](std::mt19937_64& e) {
+             static const char* values[] = {"1e-400", "9.9e308", "1e99999999999", "4.9e-324",
+                                            "1e-99999999999", "2.2250738585072011e-308"};
+             return std::string{values[e() % 6]};
+         }},
+        {"many tokens", [](std::mt19937_64& e) { return tokens(e, 10000); }},
+        {"many sparse pairs",
+         [](std::mt19937_64& e) {
+             std::string s;
+             for (std::size_t i = 0; i < 10000; ++i) {
+                 s += std::to_string(i) + ":" + std::to_string(e() % 1000) + " ";
+             }
+             return s;
+         }},
+        {"whitespace run",
+         [](std::mt19937_64& e) {
+             return std::string(100000, ' ') + std::to_string(e() % 10) + std::string(100000, '\t');
+         }},
+        {"long token", [](std::mt19937_64&) { return std::string(200000, 'f'); }},
+    };
+    return list;
+}
+
+struct Latency {
+    double p50, p99, p999, max;
+};
+
+Latency percentiles(std::vector<double>& times)
+{
+    std::sort(times.begin(), times.end());
+    const auto at = [&times](double q) {
+        return times[std::min(times.size() - 1, static_cast<std::size_t>(q * times.size()))];
+    };
+    return {at(0.5), at(0.99), at(0.999), times.back()};
+}
+
+template <typename T>
+void bench(const char* type, std::size_t lines)
+{
+    for (const auto& generator : generators()) {
+        std::mt19937_64 engine{42};
+        std::vector<std::string> input;
+        for (std::size_t i = 0; i < lines; ++i) input.push_back(generator.second(engine));
+
+        std::vector<double> times;
+        times.reserve(lines);
+        for (const auto& line : input) {
+            T t{};
+            const auto start = std::chrono::steady_clock::now();
+            const auto status = check_line(line, [](auto&&) { return true; }, t);
+            const auto stop = std::chrono::steady_clock::now();
+            (void)status;
+            times.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+        }
+
+        const auto l = percentiles(times);
+        std::printf("%-22s %-18s %10.2f %10.2f %10.2f %10.2f\n", type, generator.first, l.p50,
+                    l.p99, l.p999, l.max);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t lines = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+
+    std::printf("%-22s %-18s %10s %10s %10s %10s\n", "type", "input", "p50 us", "p99 us",
+                "p99.9 us", "max us");
+
+    bench<int>("int", lines);
+    bench<long long>("long long", lines);
+    bench<unsigned>("unsigned", lines);
+    bench<float>("float", lines);
+    bench<double>("double", lines);
+    bench<char>("char", lines);
+    bench<std::string>("std::string", lines);
+    bench<std::array<int, 4>>("std::array<int, 4>", lines);
+    bench<std::vector<int>>("std::vector<int>", lines);
+    bench<std::vector<double>>("std::vector<double>", lines);
+    bench<std::vector<std::string>>("std::vector<string>", lines);
+    bench<Sparse_vector<double>>("Sparse_vector<double>", lines);
+    bench<Hex_bytes<>>("Hex_bytes<>", lines);
+    bench<Base64_bytes<>>("Base64_bytes<>", lines);
+}
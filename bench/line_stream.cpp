@@ -0,0 +1,84 @@
+// Per-line parse cost of the reused in-place line stream, against constructing a new
+// std::istringstream for every line (which copies the line and sets up a locale each time). Both
+// paths read the same lines into a type that only provides operator>>, and into plain ints.
+//
+//     g++ -std=c++14 -O2 -I.. line_stream.cpp -o line_stream && ./line_stream [lines]
+
+#include "../ask_for.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Keeps the parse results observable so that they aren't optimised away
+volatile std::size_t consumed = 0;
+
+struct Trade {
+    long long id;
+    std::string symbol;
+    double price;
+};
+
+std::istream& operator>>(std::istream& is, Trade& trade)
+{
+    return is >> trade.id >> trade.symbol >> trade.price;
+}
+
+// The way lines were parsed before the in-place stream
+template <typename... T>
+std::ios_base::iostate fill_with_istringstream(const std::string& s, T&... t)
+{
+    std::istringstream ss{s};
+    return fill_from_stream(ss, t...);
+}
+
+template <typename F>
+double time_ns_per_line(const std::vector<std::string>& lines, F fill)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& line : lines) fill(line);
+    const auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / lines.size();
+}
+
+template <typename T>
+void compare(const char* name, const std::vector<std::string>& lines)
+{
+    T t{};
+    std::size_t sink = 0;
+    const double old_ns = time_ns_per_line(lines, [&](const std::string& s) {
+        t = T{};
+        sink += fill_with_istringstream(s, t);
+    });
+    const double new_ns = time_ns_per_line(lines, [&](const std::string& s) {
+        t = T{};
+        sink += fill_from_line(s, t);
+    });
+
+    consumed = sink;
+
+    std::printf("%-8s istringstream %8.1f ns/line   in place %8.1f ns/line   speedup %.2fx\n", name,
+                old_ns, new_ns, old_ns / new_ns);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    std::mt19937_64 engine{42};
+    std::vector<std::string> trades;
+    std::vector<std::string> ints;
+    for (std::size_t i = 0; i < count; ++i) {
+        trades.push_back(std::to_string(engine() % 1000000000) + " SYM" +
+                         std::to_string(engine() % 1000) + " " +
+                         std::to_string((engine() % 100000) / 100.0));
+        ints.push_back(std::to_string(engine() % 1000000));
+    }
+
+    compare<Trade>("Trade", trades);
+    compare<int>("int", ints);
+}
@@ -0,0 +1,110 @@
+// Latency from a line being written to a pipe to its record being parsed, reading with blocking
+// std::getline against reading through a busy-polling Poll_stream. A writer thread sends
+// timestamped lines at a fixed interval and the reader records the delay for each one.
+//
+//     g++ -std=c++14 -O2 -pthread -I.. poll_latency.cpp -o poll_latency
+//     ./poll_latency [lines] [interval us] [reader cpu]
+
+#include "../ask_for_poll.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Plain blocking reads from a descriptor, as std::cin does on a pipe
+class Blocking_streambuf : public std::streambuf {
+public:
+    explicit Blocking_streambuf(int fd) : fd_{fd} {}
+
+protected:
+    int_type underflow() override
+    {
+        while (true) {
+            const auto n = ::read(fd_, buffer_, sizeof buffer_);
+            if (n > 0) {
+                setg(buffer_, buffer_, buffer_ + n);
+                return traits_type::to_int_type(*gptr());
+            }
+            if (n == 0 || errno != EINTR) return traits_type::eof();
+        }
+    }
+
+private:
+    int fd_;
+    char buffer_[1 << 16];
+};
+
+template <typename Make_stream>
+void measure(const char* name, std::size_t lines, std::chrono::microseconds interval,
+             Make_stream make_stream)
+{
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        std::perror("pipe");
+        std::exit(1);
+    }
+
+    std::thread writer{[&] {
+        for (std::size_t i = 0; i < lines; ++i) {
+            std::this_thread::sleep_for(interval);
+            const auto line = std::to_string(now_ns()) + "\n";
+            if (::write(fds[1], line.data(), line.size()) < 0) break;
+        }
+        ::close(fds[1]);
+    }};
+
+    std::vector<double> latencies;
+    latencies.reserve(lines);
+    {
+        auto stream = make_stream(fds[0]);
+        for (auto sent : ask_stream<std::int64_t>(*stream, [](std::int64_t) { return true; })) {
+            latencies.push_back((now_ns() - sent) / 1000.0);
+        }
+    }
+    writer.join();
+    ::close(fds[0]);
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto at = [&latencies](double q) {
+        return latencies[std::min(latencies.size() - 1,
+                                  static_cast<std::size_t>(q * latencies.size()))];
+    };
+    std::printf("%-10s %8zu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, latencies.size(), at(0.5),
+                at(0.9), at(0.99), at(0.999), latencies.back());
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t lines = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    const std::chrono::microseconds interval{argc > 2 ? std::atoi(argv[2]) : 100};
+    Poll_policy policy;
+    policy.cpu = argc > 3 ? std::atoi(argv[3]) : -1;
+
+    std::printf("%-10s %8s %9s %9s %9s %9s %9s\n", "reader", "lines", "p50 us", "p90 us",
+                "p99 us", "p99.9 us", "max us");
+
+    measure("blocking", lines, interval, [](int fd) {
+        struct Stream {
+            Blocking_streambuf buffer;
+            std::istream stream{&buffer};
+            explicit Stream(int fd) : buffer{fd} {}
+        };
+        auto s = std::make_shared<Stream>(fd);
+        return std::shared_ptr<std::istream>{s, &s->stream};
+    });
+
+    measure("busy-poll", lines, interval,
+            [&policy](int fd) { return std::make_shared<Poll_stream>(fd, policy); });
+}
@@ -0,0 +1,64 @@
+// Checks that an Adaptive_fill gives exactly the same records as the normal rules, both for fields
+// its kernels parse and for those they fall back on, and that a header line doesn't stop kernels
+// from being chosen.
+//
+//     g++ -std=c++14 -O2 -I.. adaptive_fill.cpp -o adaptive_fill && ./adaptive_fill
+
+#include "../ask_for.h"
+#include <iomanip>
+
+int main()
+{
+    std::mt19937_64 engine{1};
+    std::uniform_int_distribution<unsigned> ids{0, 999999};
+    std::uniform_int_distribution<long long> cents{0, 9999999};
+
+    std::stringstream file;
+    file << "id price\n";
+    for (std::size_t i = 0; i < 100000; ++i) {
+        const auto id = ids(engine);
+        const auto price = cents(engine);
+        if (i > 1000 && i % 97 == 0) {
+            // Shapes the kernels don't cover, after profiling
+            file << id << "00 -" << price / 100 << '.' << std::setw(3) << std::setfill('0')
+                 << price % 1000 << '\n';
+        } else if (i % 89 == 0) {
+            file << "x" << id << ' ' << price << '\n';
+        } else {
+            file << id << ' ' << price / 100 << '.' << std::setw(2) << std::setfill('0')
+                 << price % 100 << '\n';
+        }
+    }
+
+    const auto condition = [](auto) { return true; };
+
+    std::vector<std::tuple<unsigned, double>> expected;
+    ask_for_all<unsigned, double>(file, condition, [&](auto&& r) { expected.push_back(r); });
+
+    file.clear();
+    file.seekg(0);
+    Adaptive_fill<unsigned, double> fill{1000};
+    std::vector<std::tuple<unsigned, double>> adaptive;
+    ask_for_all<unsigned, double>(file, condition, [&](auto&& r) { adaptive.push_back(r); }, fill);
+
+    int failures = 0;
+    if (adaptive != expected) {
+        std::cout << "adaptive records differ from the normal rules\n";
+        ++failures;
+    }
+
+    if (fill.kernel(0) != Kernel::unsigned_digits || fill.kernel(1) != Kernel::fixed_decimal) {
+        std::cout << "kernels were not chosen after a header line\n";
+        ++failures;
+    }
+
+    const auto& metrics = fill.metrics();
+    if (metrics.profiled != 1000 || metrics.fallbacks == 0 || metrics.hit_rate() < 0.95) {
+        std::cout << "profiled " << metrics.profiled << ", hits " << metrics.hits << ", fallbacks "
+                  << metrics.fallbacks << '\n';
+        ++failures;
+    }
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}
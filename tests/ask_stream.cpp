@@ -0,0 +1,93 @@
+// Checks that ask_stream skips invalid lines (or quarantines them), that its iterator supports
+// *it++, and, built as C++20, that it composes with the standard range views.
+//
+//     g++ -std=c++20 -O2 -I.. ask_stream.cpp -o ask_stream && ./ask_stream
+
+#include "../ask_for.h"
+
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+
+int failures = 0;
+
+void check(bool passed, const std::string& what)
+{
+    if (!passed) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+int main()
+{
+    const std::string input = "1 0.5\nx 2\n2 1.5\n-3 1\n3 2.5 extra\n4 3.5";
+    const auto positive = [](auto n) { return n > 0; };
+
+    {
+        std::istringstream file{input};
+        std::vector<std::tuple<int, double>> records;
+        for (auto& record : ask_stream<int, double>(file, positive)) records.push_back(record);
+        check(records == std::vector<std::tuple<int, double>>{std::make_tuple(1, 0.5),
+                                                              std::make_tuple(2, 1.5),
+                                                              std::make_tuple(4, 3.5)},
+              "invalid lines skipped");
+    }
+
+    {
+        const std::string path = "ask_stream_rejects.txt";
+        std::remove(path.c_str());
+        {
+            std::istringstream file{input};
+            Quarantine quarantine{path};
+            std::size_t count = 0;
+            for (auto& record : ask_stream<int, double>(file, positive, quarantine)) {
+                (void)record;
+                ++count;
+            }
+            check(count == 3 && quarantine.count() == 3, "invalid lines quarantined");
+        }
+
+        std::ifstream rejects{path};
+        std::vector<std::size_t> lines;
+        std::string line;
+        while (std::getline(rejects, line)) lines.push_back(std::stoul(line));
+        check(lines == std::vector<std::size_t>{2, 4, 5}, "quarantined line numbers");
+        rejects.close();
+        std::remove(path.c_str());
+    }
+
+    {
+        std::istringstream file{"5\n6\n7\n"};
+        auto stream = ask_stream<int>(file, positive);
+        auto it = stream.begin();
+        const int first = *it++;
+        const int second = *it;
+        ++it;
+        const int third = *it++;
+        check(first == 5 && second == 6 && third == 7 && it == stream.end(), "*it++");
+    }
+
+    {
+        std::istringstream file{""};
+        auto stream = ask_stream<int>(file, positive);
+        check(stream.begin() == stream.end(), "empty stream");
+    }
+
+#if __cplusplus >= 202002L
+    {
+        std::istringstream file{"1\n-2\n3\n4\n5\n6\n"};
+        std::vector<int> odd;
+        for (int n : ask_stream<int>(file, positive) |
+                         std::views::filter([](int n) { return n % 2 != 0; }) |
+                         std::views::take(2))
+        {
+            odd.push_back(n);
+        }
+        check(odd == std::vector<int>{1, 3}, "composed with std::views");
+    }
+#endif
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+// Checks that every record pushed onto a Batch_queue by several producers is popped exactly once by
+// several consumers, with a queue small enough that both sides have to wait and park.
+//
+//     g++ -std=c++14 -O2 -pthread -I.. batch_queue.cpp -o batch_queue && ./batch_queue
+
+#include "../ask_for.h"
+#include <thread>
+
+int main()
+{
+    const std::size_t producers = 4;
+    const std::size_t consumers = 4;
+    const std::uint64_t records = 200000; // Per producer
+
+    Batch_queue<std::uint64_t> queue{4};
+
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<std::uint64_t> sum{0};
+    std::vector<std::thread> threads;
+    for (std::size_t c = 0; c < consumers; ++c) {
+        // One consumer asks for no batches at all, which should be taken as one
+        const std::size_t max_batches = c == 0 ? 0 : c * 3;
+        threads.emplace_back([&queue, &count, &sum, max_batches] {
+            std::vector<std::vector<std::uint64_t>> batches;
+            while (queue.pop(batches, max_batches)) {
+                for (const auto& batch : batches) {
+                    for (const auto record : batch) {
+                        count.fetch_add(1, std::memory_order_relaxed);
+                        sum.fetch_add(record, std::memory_order_relaxed);
+                    }
+                }
+                batches.clear();
+            }
+        });
+    }
+
+    std::vector<std::thread> producer_threads;
+    for (std::size_t p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&queue, p, records] {
+            Batch_sink<std::uint64_t> sink{queue, 1 + p * 50};
+            for (std::uint64_t i = 0; i < records; ++i) sink(p * records + i + 1);
+        });
+    }
+    for (auto& thread : producer_threads) thread.join();
+    queue.close();
+    for (auto& thread : threads) thread.join();
+
+    int failures = 0;
+    const std::uint64_t total = producers * records;
+    if (count != total || sum != total * (total + 1) / 2) {
+        std::cout << "popped " << count << " records summing to " << sum << ", expected " << total
+                  << " summing to " << total * (total + 1) / 2 << '\n';
+        ++failures;
+    }
+
+    const auto metrics = queue.metrics();
+    if (metrics.pushed != metrics.popped || metrics.occupancy != 0 ||
+        metrics.high_water > metrics.capacity)
+    {
+        std::cout << "pushed " << metrics.pushed << ", popped " << metrics.popped << ", occupancy "
+                  << metrics.occupancy << ", high water " << metrics.high_water << " of "
+                  << metrics.capacity << '\n';
+        ++failures;
+    }
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+// Checks that hex and base64 fields decode every valid character, and that invalid characters and
+// wrong lengths are reported, including as the last element of a vector of fields.
+//
+//     g++ -std=c++14 -O2 -I.. binary_fields.cpp -o binary_fields && ./binary_fields
+
+#include "../ask_for.h"
+
+int failures = 0;
+
+void check(bool passed, const std::string& what)
+{
+    if (!passed) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+template <typename T>
+Line_status status(const std::string& line, T& t)
+{
+    return check_line(line, [](auto) { return true; }, t);
+}
+
+int main()
+{
+    // Every character against the reference alphabets
+    const std::string hex_digits = "0123456789abcdefABCDEF";
+    const std::string base64_digits =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int c = 0; c < 256; ++c) {
+        const auto ch = static_cast<char>(c);
+        const auto hex_position = hex_digits.find(ch);
+        const auto base64_position = base64_digits.find(ch);
+
+        std::uint8_t hex_invalid = 0;
+        const auto hex = hex_value(static_cast<std::uint8_t>(c), hex_invalid);
+        check((hex_position == std::string::npos) == (hex_invalid != 0) &&
+                  (hex_invalid || hex == (hex_position < 16 ? hex_position : hex_position - 6)),
+              "hex value of character " + std::to_string(c));
+
+        std::uint8_t base64_invalid = 0;
+        const auto base64 = base64_value(static_cast<std::uint8_t>(c), base64_invalid);
+        check((base64_position == std::string::npos) == (base64_invalid != 0) &&
+                  (base64_invalid || base64 == base64_position),
+              "base64 value of character " + std::to_string(c));
+    }
+
+    Hex_bytes<2> hex;
+    check(status("0aFf", hex) == Line_status::ok && hex.bytes[0] == 0x0a && hex.bytes[1] == 0xff,
+          "fixed hex field");
+    check(status("0aF", hex) == Line_status::parse_error, "odd length hex field");
+    check(status("0a0b0c", hex) == Line_status::parse_error, "hex field of the wrong length");
+    check(status("0azz", hex) == Line_status::parse_error, "invalid hex character");
+
+    Base64_bytes<> base64;
+    check(status("aGk=", base64) == Line_status::ok && base64.bytes.size() == 2 &&
+              base64.bytes[0] == 'h' && base64.bytes[1] == 'i',
+          "padded base64 field");
+    check(status("aGk", base64) == Line_status::parse_error, "base64 field of the wrong length");
+    check(status("aG!=", base64) == Line_status::parse_error, "invalid base64 character");
+
+    // An invalid last element is left unread, and so reported, rather than ending the list
+    std::vector<Hex_bytes<1>> hex_list;
+    check(status("aa bb", hex_list) == Line_status::ok && hex_list.size() == 2, "hex list");
+    hex_list.clear();
+    check(status("aa bb zz", hex_list) == Line_status::excess_input,
+          "invalid character ending a hex list");
+
+    std::vector<Hex_bytes<>> hex_vectors;
+    check(status("aa bbb", hex_vectors) == Line_status::excess_input,
+          "odd length ending a hex list");
+
+    std::vector<Base64_bytes<>> base64_list;
+    check(status("aGk= !!!!", base64_list) == Line_status::excess_input,
+          "invalid character ending a base64 list");
+
+    // Streams other than lines put a rejected token back where they can
+    std::istringstream stream{"aa zz"};
+    hex_list.clear();
+    stream >> hex_list;
+    std::string rest;
+    check(hex_list.size() == 1 && stream >> rest && rest == "zz", "rejected token left unread");
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}
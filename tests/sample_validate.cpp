@@ -0,0 +1,47 @@
+// Checks that sample_validate recovers a known error rate when invalid lines have unusual lengths
+// and come in runs, which defeats naive offset sampling.
+//
+//     g++ -std=c++14 -O2 -I.. sample_validate.cpp -o sample_validate && ./sample_validate
+
+#include "../ask_for.h"
+
+int main()
+{
+    std::stringstream file;
+    std::size_t lines = 0;
+    std::size_t invalid = 0;
+    for (std::size_t i = 0; i < 100000; ++i, ++lines) {
+        // Runs of 5 long garbage lines make up 10% of the lines
+        if (i % 50 < 5) {
+            file << std::string(200 + i % 7 * 50, 'x') << '\n';
+            ++invalid;
+        } else {
+            file << i << ' ' << i * 0.5 << '\n';
+        }
+    }
+    const double expected = static_cast<double>(invalid) / lines;
+
+    int failures = 0;
+    std::size_t misses = 0;
+    const std::size_t runs = 100;
+    for (std::size_t seed = 0; seed < runs; ++seed) {
+        const auto estimate =
+            sample_validate<int, double>(file, 2000, [](auto) { return true; }, 1.96, seed);
+        if (expected < estimate.lower || expected > estimate.upper) ++misses;
+
+        if (std::abs(estimate.error_rate - expected) > 0.03) {
+            std::cout << "seed " << seed << ": error rate " << estimate.error_rate
+                      << " is far from " << expected << '\n';
+            ++failures;
+        }
+    }
+
+    // A 95% interval should rarely miss
+    if (misses > runs / 10) {
+        std::cout << misses << " of " << runs << " intervals missed " << expected << '\n';
+        ++failures;
+    }
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}
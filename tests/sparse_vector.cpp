@@ -0,0 +1,88 @@
+// Checks the rules for sparse vector fields: index ordering and bounds, narrow index types, spacing
+// around the colon, and a following field ending the list.
+//
+//     g++ -std=c++14 -O2 -I.. sparse_vector.cpp -o sparse_vector && ./sparse_vector
+
+#include "../ask_for.h"
+
+int failures = 0;
+
+void check(bool passed, const std::string& what)
+{
+    if (!passed) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+template <typename... T>
+Line_status status(const std::string& line, T&... t)
+{
+    return check_line(line, [](auto) { return true; }, t...);
+}
+
+int main()
+{
+    Sparse_vector<double> v;
+    check(status("1:0.5 3:2 17:-1.25", v) == Line_status::ok && v.indices.size() == 3 &&
+              v.indices[2] == 17 && v.values[2] == -1.25,
+          "increasing indices");
+
+    v.clear();
+    check(status("", v) == Line_status::ok && v.empty(), "empty vector");
+    v.clear();
+    check(status("3:1 1:2", v) == Line_status::parse_error, "decreasing indices");
+    v.clear();
+    check(status("3:1 3:2", v) == Line_status::parse_error, "repeated index");
+    v.clear();
+    check(status("1: 2", v) == Line_status::parse_error, "space after the colon");
+    v.clear();
+    check(status("1 :2", v) != Line_status::ok, "space before the colon");
+    v.clear();
+    check(status("1:x", v) == Line_status::parse_error, "invalid value");
+
+    Sparse_vector<double, 4> bounded;
+    check(status("0:1 3:1", bounded) == Line_status::ok, "indices within the bound");
+    bounded.clear();
+    check(status("4:1", bounded) == Line_status::parse_error, "index at the bound");
+
+    // Narrow index types are read as numbers rather than characters, and range checked
+    Sparse_vector<int, 0, std::uint8_t> narrow;
+    check(status("3:4 255:1", narrow) == Line_status::ok && narrow.indices[0] == 3 &&
+              narrow.indices[1] == 255 && narrow.values[0] == 4,
+          "narrow index");
+    narrow.clear();
+    check(status("300:1", narrow) == Line_status::parse_error, "index beyond a narrow type");
+
+    Sparse_vector<int, 0, std::uint16_t> wide;
+    check(status("65535:1", wide) == Line_status::ok, "largest 16-bit index");
+    wide.clear();
+    check(status("65536:1", wide) == Line_status::parse_error, "index beyond 16 bits");
+
+    // A token that isn't a pair ends the list, so other fields can follow
+    Sparse_vector<double> row;
+    int count = 0;
+    check(status("1:2 5", row, count) == Line_status::ok && row.size() == 1 && count == 5,
+          "number following the list");
+    row.clear();
+    std::string label;
+    check(status("1:2 4:1 label", row, label) == Line_status::ok && row.size() == 2 &&
+              label == "label",
+          "word following the list");
+
+    // Rows gathered into CSR form
+    Sparse_matrix<double> matrix;
+    Sparse_vector<double> a;
+    Sparse_vector<double> b;
+    status("0:1 2:2", a);
+    status("1:3", b);
+    matrix.push_back(a);
+    matrix.push_back(Sparse_vector<double>{});
+    matrix.push_back(b);
+    check(matrix.rows() == 3 && matrix.row_offsets == std::vector<std::size_t>{0, 2, 2, 3} &&
+              matrix.indices == std::vector<std::uint32_t>{0, 2, 1},
+          "sparse matrix rows");
+
+    std::cout << (failures ? "FAILED" : "passed") << '\n';
+    return failures ? 1 : 0;
+}